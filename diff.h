@@ -29,16 +29,22 @@
 #ifndef DIFF_H
 #define DIFF_H
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
-#include <tuple>
-#include <vector>
-#ifdef YAVOM_ASYNC
+#include <cstdint>
+#include <functional>
 #include <future>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <string_view>
 #include <thread>
-#endif
-
-#define TK(v) (v + max)
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 // Yet Another Variation of Myers
 // for generic containers (for example std::vector)
@@ -48,22 +54,283 @@ namespace yavom {
 // Basic definitions
 
 enum class OP { INSERT, DELETE, _DELETE };
-using Point = std::tuple<int_fast64_t, int_fast64_t>;
+template <typename I> using BasicPoint = std::tuple<I, I>;
+using Point = BasicPoint<int_fast64_t>;
+
+template <typename K, typename I = int_fast64_t>
+using Move = std::tuple<OP, BasicPoint<I>, BasicPoint<I>, std::vector<K>>;
+
+// Policies
+// Each policy is a compile-time switch: disabled features are removed by
+// if constexpr and do not cost a branch in the search loop.
+
+// Execution: run forward and backward steps one after the other (Sequential)
+// or in separate async tasks (Async)
+struct Sequential {
+  static constexpr bool concurrent = false;
+};
+
+struct Async {
+  static constexpr bool concurrent = true;
+};
+
+// Transposition: (Experimental) allow for swapping source and target so that
+// the shortest container is always the source
+struct NoTranspose {
+  static constexpr bool enabled = false;
+};
+
+struct Transpose {
+  static constexpr bool enabled = true;
+};
+
+// Time budget: honour (StepTimeLimit) or ignore (NoTimeLimit) the ns_per_step
+// argument. Deadline also checks the Control of the diff (cancellation and
+// overall deadline) at each step d
+struct NoTimeLimit {
+  static constexpr bool enabled = false;
+  static constexpr bool controlled = false;
+};
+
+struct StepTimeLimit {
+  static constexpr bool enabled = true;
+  static constexpr bool controlled = false;
+};
+
+struct Deadline {
+  static constexpr bool enabled = true;
+  static constexpr bool controlled = true;
+};
+
+// Cancellation token, overall deadline and progress of a diff running with
+// the Deadline budget (see myers_async). Once cancel() is called or the
+// deadline is reached, each area that is still unresolved is replaced as a
+// whole (DELETE then INSERT): the script is valid but not minimal. A Control
+// can be reused: each diff starts from no progress and clears interrupted()
+// and finished(), while cancel() and the deadline stay in effect.
+struct Control {
+  using Clock = std::chrono::steady_clock;
+
+  Control() = default;
+
+  explicit Control(Clock::time_point deadline) : m_deadline{deadline} {}
+
+  explicit Control(std::chrono::nanoseconds timeout)
+      : m_deadline{Clock::now() + timeout} {}
+
+  void cancel() noexcept { m_cancelled = true; }
+
+  auto expired() const noexcept -> bool {
+    return m_cancelled.load(std::memory_order_relaxed) ||
+           Clock::now() >= m_deadline;
+  }
+
+  // True if the search gave up on some area
+  auto interrupted() const noexcept -> bool { return m_interrupted; }
+
+  // Fraction of the area (N * M) resolved so far, in [0, 1]. The area being
+  // searched counts for the fraction of its steps d already explored, so the
+  // estimate can run ahead of the actual resolution: the returned value never
+  // decreases.
+  auto progress() const noexcept -> double {
+    if (m_finished) {
+      return 1.0;
+    }
+    const auto total{m_total.load()};
+    const auto current{
+        total > 0 ? std::min(1.0, (m_resolved.load() + m_exploring.load()) /
+                                      total)
+                  : 0.0};
+    auto reported{m_reported.load()};
+    while (reported < current &&
+           !m_reported.compare_exchange_weak(reported, current)) {
+    }
+    return std::max(reported, current);
+  }
+
+  auto finished() const noexcept -> bool { return m_finished; }
+
+  // Called by the search (single writer)
+  void start(double total) noexcept {
+    m_interrupted = false;
+    m_finished = false;
+    m_resolved = 0;
+    m_exploring = 0;
+    m_reported = 0;
+    m_total = total;
+  }
+
+  void resolve(double cells) noexcept {
+    m_resolved.store(m_resolved.load(std::memory_order_relaxed) + cells,
+                     std::memory_order_relaxed);
+  }
+
+  // Cells of the area being searched that count as explored
+  void explore(double cells) noexcept {
+    m_exploring.store(cells, std::memory_order_relaxed);
+  }
+
+  void interrupt() noexcept { m_interrupted = true; }
+
+  void finish() noexcept { m_finished = true; }
+
+  std::atomic<bool> m_cancelled{false};
+  std::atomic<bool> m_interrupted{false};
+  std::atomic<bool> m_finished{false};
+  std::atomic<double> m_total{0};
+  std::atomic<double> m_resolved{0};
+  std::atomic<double> m_exploring{0};
+  mutable std::atomic<double> m_reported{0};
+  Clock::time_point m_deadline{Clock::time_point::max()};
+};
+
+// Statistics: NoStats compiles to nothing, BasicStats counts the work done
+struct NoStats {
+  void middle_move(int_fast64_t, int_fast64_t) noexcept {}
+  void step(int_fast64_t) noexcept {}
+  void timeout() noexcept {}
+};
+
+struct BasicStats {
+  void middle_move(int_fast64_t, int_fast64_t) noexcept { ++middle_moves; }
+  void step(int_fast64_t d) noexcept {
+    ++steps;
+    max_d = std::max(max_d, d);
+  }
+  void timeout() noexcept { ++timeouts; }
+
+  int_fast64_t middle_moves{0};
+  int_fast64_t steps{0};
+  int_fast64_t max_d{0};
+  int_fast64_t timeouts{0};
+};
+
+// Index width: coordinates and V arrays use Index (int32_t or int_fast64_t).
+// AutoIndex searches with int32_t whenever the inputs fit, but still returns
+// int_fast64_t moves
+struct AutoIndex {};
+
+template <typename I>
+auto index_fits(std::size_t n, std::size_t m) noexcept -> bool {
+  // V arrays hold 2 * (N + M) + 1 diagonals
+  constexpr auto limit{
+      static_cast<std::size_t>((std::numeric_limits<I>::max() - 1) / 2)};
+  return n <= limit && m <= limit - n;
+}
 
-template <typename K> using Move = std::tuple<OP, Point, Point, std::vector<K>>;
+// Equal is any default constructible binary predicate on elements (for
+// example a comparator on precomputed hashes)
+template <typename Execution = Sequential, typename Transposition = NoTranspose,
+          typename Equal = std::equal_to<>, typename Budget = StepTimeLimit,
+          typename Stats = NoStats, typename Index = AutoIndex>
+struct Policy {
+  using execution = Execution;
+  using transposition = Transposition;
+  using equal = Equal;
+  using budget = Budget;
+  using stats = Stats;
+  using index = Index;
+  // Index type of the returned moves
+  using move_index =
+      std::conditional_t<std::is_same_v<Index, AutoIndex>, int_fast64_t, Index>;
 
-template <template <typename, typename...> typename C, typename K,
+  template <typename I>
+  using with_index = Policy<Execution, Transposition, Equal, Budget, Stats, I>;
+
+  template <typename B>
+  using with_budget = Policy<Execution, Transposition, Equal, B, Stats, Index>;
+};
+
+// Calls search(Q{}) where Q is P, or P with the narrowest index that fits
+// containers of n and m elements when P uses AutoIndex
+template <typename P, typename F>
+void with_fitting_index(std::size_t n, std::size_t m, F &&search) {
+  if constexpr (std::is_same_v<typename P::index, AutoIndex>) {
+    if (index_fits<int32_t>(n, m)) {
+      search(typename P::template with_index<int32_t>{});
+    } else {
+      search(typename P::template with_index<int_fast64_t>{});
+    }
+  } else {
+    assert(index_fits<typename P::index>(n, m));
+    search(P{});
+  }
+}
+
+// Tokenizers for myers_refined: a line is split into a container of tokens
+// that refers to the line itself (nothing is copied)
+struct CharTokens {
+  template <typename S> static auto tokens(const S &line) {
+    return std::basic_string_view<typename S::value_type,
+                                  typename S::traits_type>{line};
+  }
+};
+
+struct WordTokens {
+  // Words and runs of blanks are separate tokens, so that joining the tokens
+  // gives back the line
+  template <typename S> static auto tokens(const S &line) {
+    using View = std::basic_string_view<typename S::value_type,
+                                        typename S::traits_type>;
+    auto blank = [](auto c) { return c == ' ' || c == '\t'; };
+    View view{line};
+    std::vector<View> result;
+    std::size_t start{0};
+    while (start < view.size()) {
+      auto end{start + 1};
+      while (end < view.size() && blank(view[end]) == blank(view[start])) {
+        ++end;
+      }
+      result.push_back(view.substr(start, end - start));
+      start = end;
+    }
+    return result;
+  }
+};
+
+template <typename T, typename S>
+using TokenOf =
+    typename decltype(T::tokens(std::declval<const S &>()))::value_type;
+
+// Edit script between line a_index of a and line b_index of b
+template <typename K, typename I = int_fast64_t>
+using Refinement = std::tuple<I, I, std::vector<Move<K, I>>>;
+
+// 128-bit content hash of a pair of containers
+using Digest = std::tuple<std::uint64_t, std::uint64_t>;
+
+// Content defined chunk [begin, end) of a container and its fingerprint
+template <typename I> using Chunk = std::tuple<I, I, std::uint64_t>;
+
+// The YAVOM_ASYNC and YAVOM_TRANSPOSE macros only select the default policy
+#ifdef YAVOM_ASYNC
+using DefaultExecution = Async;
+#else
+using DefaultExecution = Sequential;
+#endif
+
+#ifdef YAVOM_TRANSPOSE
+using DefaultTransposition = Transpose;
+#else
+using DefaultTransposition = NoTranspose;
+#endif
+
+using DefaultPolicy = Policy<DefaultExecution, DefaultTransposition>;
+
+template <typename P, template <typename, typename...> typename C, typename K,
           typename... Args>
 struct Area {
+  using I = typename P::index;
+
   Area(const C<K, Args...> &a, const C<K, Args...> &b)
-      : m_a{a}, m_b{b}, m_tl{0, 0}, m_br{static_cast<int_fast64_t>(a.size()),
-                                         static_cast<int_fast64_t>(b.size())} {
+      : m_a{a}, m_b{b}, m_tl{0, 0}, m_br{static_cast<I>(a.size()),
+                                         static_cast<I>(b.size())} {
     assert(std::get<0>(m_tl) <= std::get<0>(m_br));
     assert(std::get<1>(m_tl) <= std::get<1>(m_br));
     trim();
   }
 
-  Area(const Area &base, Point tl, Point br)
+  Area(const Area &base, BasicPoint<I> tl, BasicPoint<I> br)
       : m_a{base.m_a}, m_b{base.m_b}, m_tl{tl}, m_br{br} {
     assert(contains_abs(tl));
     assert(contains_abs(br));
@@ -72,76 +339,91 @@ struct Area {
     trim();
   }
 
-  auto a(int_fast64_t index) const noexcept -> const K& {
+  auto a(I index) const noexcept -> const K& {
     return m_a[std::get<0>(m_tl) + index];
   }
 
-  auto b(int_fast64_t index) const noexcept -> const K& {
+  auto b(I index) const noexcept -> const K& {
     return m_b[std::get<1>(m_tl) + index];
   }
 
-  auto ra(int_fast64_t index) const noexcept -> const K& {
+  auto ra(I index) const noexcept -> const K& {
     return m_a[std::get<0>(m_br) - 1 - index];
   }
 
-  auto rb(int_fast64_t index) const noexcept -> const K& {
+  auto rb(I index) const noexcept -> const K& {
     return m_b[std::get<1>(m_br) - 1 - index];
   }
 
-  auto N() const noexcept -> int_fast64_t { return m_N; }
+  auto match(I x, I y) const -> bool {
+    return typename P::equal{}(a(x), b(y));
+  }
+
+  auto rmatch(I x, I y) const -> bool {
+    return typename P::equal{}(ra(x), rb(y));
+  }
+
+  auto N() const noexcept -> I { return m_N; }
 
-  auto M() const noexcept -> int_fast64_t { return m_M; }
+  // Number of cells of the edit graph
+  auto cells() const noexcept -> double {
+    return static_cast<double>(m_N) * static_cast<double>(m_M);
+  }
+
+  auto M() const noexcept -> I { return m_M; }
 
-  auto cN() const noexcept -> int_fast64_t {
+  auto cN() const noexcept -> I {
     assert(std::get<0>(m_br) >= std::get<0>(m_tl));
     return std::get<0>(m_br) - std::get<0>(m_tl);
   }
 
-  auto cM() const noexcept -> int_fast64_t {
+  auto cM() const noexcept -> I {
     assert(std::get<1>(m_br) >= std::get<1>(m_tl));
     return std::get<1>(m_br) - std::get<1>(m_tl);
   }
 
-  auto abs_point_r(int_fast64_t rel_x, int_fast64_t rel_y) const noexcept -> Point {
+  auto abs_point_r(I rel_x, I rel_y) const noexcept -> BasicPoint<I> {
     return {std::get<0>(m_tl) + N() - rel_x, std::get<1>(m_tl) + M() - rel_y};
   }
 
-  auto abs_point(int_fast64_t rel_x, int_fast64_t rel_y) const noexcept -> Point {
+  auto abs_point(I rel_x, I rel_y) const noexcept -> BasicPoint<I> {
     return {std::get<0>(m_tl) + rel_x, std::get<1>(m_tl) + rel_y};
   }
 
-  auto point_r(Point p) const noexcept -> Point {
+  auto point_r(BasicPoint<I> p) const noexcept -> BasicPoint<I> {
     return {N() - std::get<0>(p), M() - std::get<1>(p)};
   }
 
-  auto rdiagonal(int_fast64_t k) const noexcept -> int_fast64_t {
+  auto rdiagonal(I k) const noexcept -> I {
     return (-k + (N() - M()));
   }
 
-  auto contains_abs(Point p) const noexcept -> bool {
+  auto contains_abs(BasicPoint<I> p) const noexcept -> bool {
     return std::get<0>(p) >= std::get<0>(m_tl) &&
            std::get<0>(p) <= std::get<0>(m_br) &&
            std::get<1>(p) >= std::get<1>(m_tl) &&
            std::get<1>(p) <= std::get<1>(m_br);
   }
 
-  auto tl() const noexcept -> const Point & { return m_tl; }
+  auto tl() const noexcept -> const BasicPoint<I> & { return m_tl; }
 
-  auto br() const noexcept -> const Point & { return m_br; }
+  auto br() const noexcept -> const BasicPoint<I> & { return m_br; }
 
   auto a() const noexcept -> const C<K, Args...> & { return m_a; }
   auto b() const noexcept ->  const C<K, Args...> & { return m_b; }
 
-  void trim() noexcept {
+  void trim() {
     while (std::get<0>(m_tl) < std::get<0>(m_br) &&
            std::get<1>(m_tl) < std::get<1>(m_br) &&
-           m_a[std::get<0>(m_tl)] == m_b[std::get<1>(m_tl)]) {
+           typename P::equal{}(m_a[std::get<0>(m_tl)],
+                               m_b[std::get<1>(m_tl)])) {
       ++std::get<0>(m_tl);
       ++std::get<1>(m_tl);
     }
     while (std::get<0>(m_br) > std::get<0>(m_tl) &&
            std::get<1>(m_br) > std::get<1>(m_tl) &&
-           m_a[std::get<0>(m_br) - 1] == m_b[std::get<1>(m_br) - 1]) {
+           typename P::equal{}(m_a[std::get<0>(m_br) - 1],
+                               m_b[std::get<1>(m_br) - 1])) {
       --std::get<0>(m_br);
       --std::get<1>(m_br);
     }
@@ -151,50 +433,398 @@ struct Area {
 
   const C<K, Args...> &m_a;
   const C<K, Args...> &m_b;
-  Point m_tl{0, 0};
-  Point m_br{0, 0};
-  int_fast64_t m_N{0};
-  int_fast64_t m_M{0};
+  BasicPoint<I> m_tl{0, 0};
+  BasicPoint<I> m_br{0, 0};
+  I m_N{0};
+  I m_M{0};
+};
+
+// Furthest reaching x on each diagonal k. Only the band of diagonals
+// [-band(), band()] is allocated: it is centered on diagonal 0 and doubled
+// (up to the limit) whenever the search needs a wider band. Diagonals that
+// were not explored yet hold 0.
+template <typename I> struct Diagonals {
+  Diagonals(I band, I limit) : m_band{std::min(band, limit)}, m_limit{limit} {
+    m_v.resize(2 * m_band + 1, 0);
+  }
+
+  // Make diagonals [-d, d] addressable
+  void grow(I d) {
+    assert(d <= m_limit);
+    if (d <= m_band) {
+      return;
+    }
+    auto band{m_band};
+    while (band < d) {
+      band = std::min(band * 2 + 1, m_limit);
+    }
+    std::vector<I> v(2 * band + 1, 0);
+    std::copy(m_v.begin(), m_v.end(), v.begin() + (band - m_band));
+    m_v.swap(v);
+    m_band = band;
+  }
+
+  // Pointer to diagonal 0, valid until the next grow()
+  auto center() noexcept -> I * { return m_v.data() + m_band; }
+
+  auto band() const noexcept -> I { return m_band; }
+
+  std::vector<I> m_v;
+  I m_band{0};
+  I m_limit{0};
+};
+
+// Sequence for in-place patching of large documents: a piece table whose
+// pieces are kept in an implicit treap, so that erase and insert cost
+// O(log n) (plus the inserted elements) instead of shifting the tail.
+// Inserted elements are appended to a buffer that is never shrunk: rebuild
+// from flatten() to reclaim it.
+template <typename K> class Rope {
+public:
+  Rope() = default;
+
+  explicit Rope(std::vector<K> v) : m_original{std::move(v)} {
+    if (!m_original.empty()) {
+      m_root = make_node(false, 0, m_original.size(), next_priority());
+    }
+  }
+
+  auto size() const noexcept -> std::size_t { return total(m_root); }
+
+  auto empty() const noexcept -> bool { return m_root == npos; }
+
+  void erase(std::size_t pos, std::size_t count) {
+    assert(pos + count <= size());
+    auto [left, rest] = split(m_root, pos);
+    auto [middle, right] = split(rest, count);
+    release(middle);
+    m_root = merge(left, right);
+  }
+
+  template <typename It> void insert(std::size_t pos, It first, It last) {
+    assert(pos <= size());
+    const auto offset{m_added.size()};
+    m_added.insert(m_added.end(), first, last);
+    if (m_added.size() == offset) {
+      return;
+    }
+    auto piece = make_node(true, offset, m_added.size() - offset,
+                           next_priority());
+    auto [left, right] = split(m_root, pos);
+    m_root = merge(merge(left, piece), right);
+  }
+
+  auto operator[](std::size_t pos) const -> const K & {
+    assert(pos < size());
+    auto t{m_root};
+    while (true) {
+      const auto &n = m_nodes[t];
+      const auto left{total(n.left)};
+      if (pos < left) {
+        t = n.left;
+      } else if (pos < left + n.length) {
+        return buffer(n)[n.offset + pos - left];
+      } else {
+        pos -= left + n.length;
+        t = n.right;
+      }
+    }
+  }
+
+  auto flatten() const -> std::vector<K> {
+    std::vector<K> result;
+    result.reserve(size());
+    std::vector<std::size_t> stack;
+    auto t{m_root};
+    while (t != npos || !stack.empty()) {
+      while (t != npos) {
+        stack.push_back(t);
+        t = m_nodes[t].left;
+      }
+      const auto &n = m_nodes[stack.back()];
+      stack.pop_back();
+      const auto &b = buffer(n);
+      result.insert(result.end(), b.begin() + n.offset,
+                    b.begin() + n.offset + n.length);
+      t = n.right;
+    }
+    return result;
+  }
+
+private:
+  static constexpr std::size_t npos{std::numeric_limits<std::size_t>::max()};
+
+  struct Node {
+    bool added{false};
+    std::size_t offset{0};
+    std::size_t length{0};
+    std::size_t total{0};
+    std::size_t left{npos};
+    std::size_t right{npos};
+    std::uint32_t priority{0};
+  };
+
+  auto buffer(const Node &n) const noexcept -> const std::vector<K> & {
+    return n.added ? m_added : m_original;
+  }
+
+  auto total(std::size_t t) const noexcept -> std::size_t {
+    return t == npos ? 0 : m_nodes[t].total;
+  }
+
+  void update(std::size_t t) noexcept {
+    auto &n = m_nodes[t];
+    n.total = total(n.left) + n.length + total(n.right);
+  }
+
+  auto next_priority() noexcept -> std::uint32_t {
+    // xorshift32
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+  }
+
+  auto make_node(bool added, std::size_t offset, std::size_t length,
+                 std::uint32_t priority) -> std::size_t {
+    Node n{added, offset, length, length, npos, npos, priority};
+    if (!m_free.empty()) {
+      auto t = m_free.back();
+      m_free.pop_back();
+      m_nodes[t] = n;
+      return t;
+    }
+    m_nodes.push_back(n);
+    return m_nodes.size() - 1;
+  }
+
+  void release(std::size_t t) {
+    std::vector<std::size_t> stack;
+    if (t != npos) {
+      stack.push_back(t);
+    }
+    while (!stack.empty()) {
+      const auto &n = m_nodes[stack.back()];
+      m_free.push_back(stack.back());
+      stack.pop_back();
+      for (auto child : {n.left, n.right}) {
+        if (child != npos) {
+          stack.push_back(child);
+        }
+      }
+    }
+  }
+
+  // Split t into the first pos elements and the rest
+  auto split(std::size_t t, std::size_t pos)
+      -> std::tuple<std::size_t, std::size_t> {
+    if (t == npos) {
+      return {npos, npos};
+    }
+    const auto left{total(m_nodes[t].left)};
+    const auto length{m_nodes[t].length};
+    if (pos <= left) {
+      auto [l, r] = split(m_nodes[t].left, pos);
+      m_nodes[t].left = r;
+      update(t);
+      return {l, t};
+    } else if (pos >= left + length) {
+      auto [l, r] = split(m_nodes[t].right, pos - left - length);
+      m_nodes[t].right = l;
+      update(t);
+      return {t, r};
+    }
+    // Cut the piece in two: the tail gets a fresh priority and is merged
+    // with the right subtree, otherwise every piece cut from the original
+    // document would share one priority and the treap would degenerate
+    const auto cut{pos - left};
+    auto tail = make_node(m_nodes[t].added, m_nodes[t].offset + cut,
+                          length - cut, next_priority());
+    const auto right{m_nodes[t].right};
+    m_nodes[t].length = cut;
+    m_nodes[t].right = npos;
+    update(t);
+    return {t, merge(tail, right)};
+  }
+
+  auto merge(std::size_t l, std::size_t r) -> std::size_t {
+    if (l == npos) {
+      return r;
+    } else if (r == npos) {
+      return l;
+    } else if (m_nodes[l].priority > m_nodes[r].priority) {
+      m_nodes[l].right = merge(m_nodes[l].right, r);
+      update(l);
+      return l;
+    }
+    m_nodes[r].left = merge(l, m_nodes[r].left);
+    update(r);
+    return r;
+  }
+
+  std::vector<K> m_original;
+  std::vector<K> m_added;
+  std::vector<Node> m_nodes;
+  std::vector<std::size_t> m_free;
+  std::size_t m_root{npos};
+  std::uint32_t m_seed{2463534242u};
 };
 
 // Forward declarations
 
-template <template <typename, typename...> typename C, typename K,
+template <template <typename, typename...> typename C, typename K, typename I,
           typename... Args>
-void apply_move(const Move<K> &m, C<K, Args...> &a);
+void apply_move(const Move<K, I> &m, C<K, Args...> &a);
+
+template <typename K, typename I>
+void apply_move(const Move<K, I> &m, Rope<K> &a);
 
-template <template <typename, typename...> typename C, typename K,
+template <template <typename, typename...> typename C, typename K, typename I,
           typename... Args>
-std::tuple<Point, Point> myers_middle_move(const Area<C, K> &area,
-                                           int_fast64_t ns_per_step);
+void apply_moves(const std::vector<Move<K, I>> &s, C<K, Args...> &a);
+
+template <typename K, typename I>
+void apply_moves(const std::vector<Move<K, I>> &s, Rope<K> &a);
 
-template <template <typename, typename...> typename C, typename K,
+template <typename P, template <typename, typename...> typename C, typename K,
           typename... Args>
-void myers_moves(Area<C, K> area, std::vector<Move<K>> &result,
-                 int_fast64_t ns_per_step);
+std::tuple<BasicPoint<typename P::index>, BasicPoint<typename P::index>>
+myers_middle_move(const Area<P, C, K, Args...> &area, int_fast64_t ns_per_step,
+                  typename P::stats &stats, Control &control);
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename R, typename... Args>
+void myers_moves(Area<P, C, K, Args...> area, std::vector<Move<K, R>> &result,
+                 int_fast64_t ns_per_step, typename P::stats &stats,
+                 Control &control);
 
 template <typename P> void inner_swap(P &p);
 
-template <template <typename, typename...> typename C, typename K,
+template <typename K, typename R>
+void transpose_moves(std::vector<Move<K, R>> &s);
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename R, typename... Args>
+void myers_search(const C<K, Args...> &a, const C<K, Args...> &b,
+                  std::vector<Move<K, R>> &s, int_fast64_t ns_per_step,
+                  typename P::stats &stats, Control &control);
+
+template <typename P = DefaultPolicy,
+          template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers(const C<K, Args...> &a, const C<K, Args...> &b,
+      int_fast64_t ns_per_step = -1);
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers(const C<K, Args...> &a, const C<K, Args...> &b, int_fast64_t ns_per_step,
+      typename P::stats &stats);
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers(const C<K, Args...> &a, const C<K, Args...> &b, int_fast64_t ns_per_step,
+      typename P::stats &stats, Control &control);
+
+template <typename P = DefaultPolicy,
+          template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::future<std::vector<Move<K, typename P::move_index>>>
+myers_async(const C<K, Args...> &a, const C<K, Args...> &b, Control &control,
+            int_fast64_t ns_per_step = -1);
+
+template <typename P = DefaultPolicy,
+          template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_unfilled(const C<K, Args...> &a, const C<K, Args...> &b,
+               int_fast64_t ns_per_step = -1);
+
+template <typename P, template <typename, typename...> typename C, typename K,
           typename... Args>
-std::vector<Move<K>> myers(const C<K, Args...> &a, const C<K, Args...> &b,
-                           int_fast64_t ns_per_step = -1);
+std::vector<Move<K, typename P::move_index>>
+myers_unfilled(const C<K, Args...> &a, const C<K, Args...> &b,
+               int_fast64_t ns_per_step, typename P::stats &stats);
 
-template <template <typename, typename...> typename C, typename K,
+template <typename P, template <typename, typename...> typename C, typename K,
           typename... Args>
-std::vector<Move<K>> myers_unfilled(const C<K, Args...> &a,
-                                    const C<K, Args...> &b,
-                                    int_fast64_t ns_per_step = -1);
+std::vector<Move<K, typename P::move_index>>
+myers_unfilled(const C<K, Args...> &a, const C<K, Args...> &b,
+               int_fast64_t ns_per_step, typename P::stats &stats,
+               Control &control);
 
-template <template <typename, typename...> typename C, typename K,
+template <template <typename, typename...> typename C, typename K, typename I,
           typename... Args>
-void myers_fill(const C<K, Args...> &b, std::vector<Move<K>> &s);
+std::vector<Chunk<I>> content_chunks(const C<K, Args...> &c, I first, I last,
+                                     std::size_t block_size);
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename R, typename... Args>
+void myers_coarse_search(const C<K, Args...> &a, const C<K, Args...> &b,
+                         std::vector<Move<K, R>> &s, int_fast64_t ns_per_step,
+                         std::size_t block_size, typename P::stats &stats,
+                         Control &control);
+
+template <typename P = DefaultPolicy,
+          template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_coarse_unfilled(const C<K, Args...> &a, const C<K, Args...> &b,
+                      int_fast64_t ns_per_step = -1,
+                      std::size_t block_size = 64);
+
+template <typename P = DefaultPolicy,
+          template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_coarse(const C<K, Args...> &a, const C<K, Args...> &b,
+             int_fast64_t ns_per_step = -1, std::size_t block_size = 64);
+
+template <typename Equal, template <typename, typename...> typename C,
+          typename K, typename I, typename... Args>
+auto common_run(const C<K, Args...> &a, I x, I N, const C<K, Args...> &b, I y,
+                I M) -> I;
+
+template <typename P = DefaultPolicy, typename Less = std::less<>,
+          template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_sorted_unfilled(const C<K, Args...> &a, const C<K, Args...> &b);
+
+template <typename P = DefaultPolicy, typename Less = std::less<>,
+          template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_sorted(const C<K, Args...> &a, const C<K, Args...> &b);
+
+template <template <typename, typename...> typename C, typename K, typename I,
+          typename... Args>
+void myers_fill(const C<K, Args...> &b, std::vector<Move<K, I>> &s);
+
+template <template <typename, typename...> typename C, typename K, typename I,
+          typename... Args>
+std::vector<Move<K, I>> invert(const std::vector<Move<K, I>> &s,
+                               const C<K, Args...> &a);
+
+template <typename P = DefaultPolicy, typename T = CharTokens,
+          template <typename, typename...> typename C, typename S,
+          typename... Args>
+std::tuple<std::vector<Move<S, typename P::move_index>>,
+           std::vector<Refinement<TokenOf<T, S>, typename P::move_index>>>
+myers_refined(const C<S, Args...> &a, const C<S, Args...> &b,
+              int_fast64_t ns_per_step = -1);
+
+template <typename H = void, template <typename, typename...> typename C,
+          typename K, typename... Args>
+Digest content_digest(const C<K, Args...> &a, const C<K, Args...> &b);
 
 // Definitions
 
-template <template <typename, typename...> typename C, typename K,
+template <template <typename, typename...> typename C, typename K, typename I,
           typename... Args>
-void apply_move(const Move<K> &m, C<K, Args...> &a) {
+void apply_move(const Move<K, I> &m, C<K, Args...> &a) {
   const auto &[m_op, m_s, m_t, v] = m;
   switch (m_op) {
   case OP::DELETE: {
@@ -215,62 +845,131 @@ void apply_move(const Move<K> &m, C<K, Args...> &a) {
   }
 }
 
-#ifdef YAVOM_ASYNC
-template <template <typename, typename...> typename C, typename K,
+template <typename K, typename I>
+void apply_move(const Move<K, I> &m, Rope<K> &a) {
+  const auto &[m_op, m_s, m_t, v] = m;
+  switch (m_op) {
+  case OP::DELETE: {
+    auto count{std::get<0>(m_t) - std::get<0>(m_s)};
+    a.erase(std::get<1>(m_s), count);
+    break;
+  }
+  case OP::_DELETE: {
+    const auto &[count, start] = m_s;
+    a.erase(start, count);
+    break;
+  }
+  case OP::INSERT: {
+    a.insert(std::get<1>(m_s), v.begin(), v.end());
+    break;
+  }
+  }
+}
+
+// Moves are sorted by position: rebuild a in a single pass instead of
+// shifting its tail on every move
+template <template <typename, typename...> typename C, typename K, typename I,
           typename... Args>
-std::tuple<Point, Point> myers_middle_move(const Area<C, K> &area,
-                                           int_fast64_t ns_per_step) {
+void apply_moves(const std::vector<Move<K, I>> &s, C<K, Args...> &a) {
+  C<K, Args...> result;
+  auto next{a.begin()};
+  I position{0};
+  for (const auto &[m_op, m_s, m_t, v] : s) {
+    const auto start{std::get<1>(m_s)};
+    assert(start >= position);
+    result.insert(result.end(), next, next + (start - position));
+    next += start - position;
+    position = start;
+    switch (m_op) {
+    case OP::DELETE: {
+      next += std::get<0>(m_t) - std::get<0>(m_s);
+      break;
+    }
+    case OP::_DELETE: {
+      next += std::get<0>(m_s);
+      break;
+    }
+    case OP::INSERT: {
+      result.insert(result.end(), v.begin(), v.end());
+      position += static_cast<I>(v.size());
+      break;
+    }
+    }
+  }
+  result.insert(result.end(), next, a.end());
+  a = std::move(result);
+}
+
+template <typename K, typename I>
+void apply_moves(const std::vector<Move<K, I>> &s, Rope<K> &a) {
+  for (const auto &m : s) {
+    apply_move(m, a);
+  }
+}
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::tuple<BasicPoint<typename P::index>, BasicPoint<typename P::index>>
+myers_middle_move(const Area<P, C, K, Args...> &area, int_fast64_t ns_per_step,
+                  typename P::stats &stats, Control &control) {
+  using I = typename P::index;
+  stats.middle_move(area.N(), area.M());
   auto max{area.M() + area.N()};
-  std::vector<int_fast64_t> V_fwd{static_cast<int_fast64_t>(2 * max + 1), 0};
-  V_fwd.resize(2 * max + 1);
-  V_fwd[1] = 0;
-  assert(static_cast<int_fast64_t>(V_fwd.capacity()) ==
-         static_cast<int_fast64_t>(2 * max + 1));
-  int_fast64_t x_fwd{0}, y_fwd{0};
-
-  std::vector<int_fast64_t> V_bwd{static_cast<int_fast64_t>(2 * max + 1), 0};
-  V_bwd.resize(2 * max + 1);
-  V_bwd[1] = 0;
-  assert(static_cast<int_fast64_t>(V_bwd.capacity()) ==
-         static_cast<int_fast64_t>(2 * max + 1));
-  int_fast64_t x_bwd{0}, y_bwd{0};
-
-  auto start_time = std::chrono::high_resolution_clock::now();
-  for (int d{0}; d <= static_cast<int_fast64_t>(max); ++d) {
-    auto min_valid_k = -d + std::max(static_cast<int_fast64_t>(0l),
-                                     d - static_cast<int_fast64_t>(area.M())) *
+  // Only diagonals in [-d, d] are touched at step d: start with a small band
+  // and let it grow with the edit distance
+  Diagonals<I> D_fwd{64, max};
+  Diagonals<I> D_bwd{64, max};
+
+  enum class StepRetStatus { SUCCESS, NEED_MORE, EXHAUSTED };
+  using StepRetType =
+      std::tuple<StepRetStatus, std::tuple<BasicPoint<I>, BasicPoint<I>>>;
+
+  std::chrono::high_resolution_clock::time_point start_time;
+  if constexpr (P::budget::enabled) {
+    start_time = std::chrono::high_resolution_clock::now();
+  }
+  for (I d{0}; d <= max; ++d) {
+    stats.step(d);
+    // Grow both bands before stepping, the async steps read each other's
+    D_fwd.grow(d);
+    D_bwd.grow(d);
+    I *V_fwd = D_fwd.center();
+    I *V_bwd = D_bwd.center();
+    const auto band{D_fwd.band()};
+    auto min_valid_k = -d + std::max(static_cast<I>(0l),
+                                     d - static_cast<I>(area.M())) *
                                 2;
-    auto max_valid_k = d - std::max(static_cast<int_fast64_t>(0l),
-                                    d - static_cast<int_fast64_t>(area.N())) *
+    auto max_valid_k = d - std::max(static_cast<I>(0l),
+                                    d - static_cast<I>(area.N())) *
                                2;
-    enum class StepRetStatus { SUCCESS, NEED_MORE, EXHAUSTED };
-    using StepRetType = std::tuple<StepRetStatus, std::tuple<Point, Point>>;
-    auto ft = std::async([&]() -> StepRetType {
-      for (int_fast64_t k = min_valid_k; k <= max_valid_k; k += 2) {
-        int_fast64_t px{0};
+    // Forward step
+    auto forward_step = [&]() -> StepRetType {
+      I px{0}, x_fwd{0}, y_fwd{0};
+      for (I k = min_valid_k; k <= max_valid_k; k += 2) {
         // Move downward or to the right
-        if (k == -d || ((k != d) && (V_fwd[TK(k - 1)] < V_fwd[TK(k + 1)]))) {
-          px = x_fwd = V_fwd[TK(k + 1)];
+        if (k == -d || ((k != d) && (V_fwd[k - 1] < V_fwd[k + 1]))) {
+          px = x_fwd = V_fwd[k + 1];
         } else {
-          x_fwd = px = V_fwd[TK(k - 1)] + 1;
+          x_fwd = px = V_fwd[k - 1] + 1;
         }
         y_fwd = x_fwd - k;
         // Follow diagonal as long as possible
         while ((x_fwd < area.N()) && (y_fwd < area.M()) &&
-               (area.a(x_fwd) == area.b(y_fwd))) {
+               area.match(x_fwd, y_fwd)) {
           ++x_fwd;
           ++y_fwd;
         }
         // Store best x position on this diagonal
-        V_fwd[TK(k)] = x_fwd;
+        V_fwd[k] = x_fwd;
 
         // Check if we crossed the backward move
         if (d > 0) {
           const auto rk = area.rdiagonal(k);
-          if (x_fwd >= (area.N() - V_bwd[TK(rk)])) {
-            Point top = area.abs_point(px, px - k);
+          const I rx = (rk >= -band && rk <= band) ? V_bwd[rk] : 0;
+          if (x_fwd >= (area.N() - rx)) {
+            BasicPoint<I> top = area.abs_point(px, px - k);
             if (area.contains_abs(top)) {
-              Point bottom = area.abs_point(x_fwd, y_fwd);
+              BasicPoint<I> bottom = area.abs_point(x_fwd, y_fwd);
               if (area.contains_abs(bottom)) {
                 return {StepRetStatus::SUCCESS, {top, bottom}};
               }
@@ -283,197 +982,102 @@ std::tuple<Point, Point> myers_middle_move(const Area<C, K> &area,
         }
       }
       return {StepRetStatus::NEED_MORE, {{0, 0}, {0, 0}}};
-    });
+    };
 
     // Backward step
-    auto bt = std::async([&]() -> StepRetType {
-      for (int_fast64_t k = min_valid_k; k <= max_valid_k; k += 2) {
-        int_fast64_t px{0};
+    auto backward_step = [&]() -> StepRetType {
+      I px{0}, x_bwd{0}, y_bwd{0};
+      for (I k = min_valid_k; k <= max_valid_k; k += 2) {
         // Move downward or to the right
-        if (k == -d || ((k != d) && (V_bwd[TK(k - 1)] < V_bwd[TK(k + 1)]))) {
-          px = x_bwd = V_bwd[TK(k + 1)];
+        if (k == -d || ((k != d) && (V_bwd[k - 1] < V_bwd[k + 1]))) {
+          px = x_bwd = V_bwd[k + 1];
         } else {
-          x_bwd = px = V_bwd[TK(k - 1)] + 1;
+          x_bwd = px = V_bwd[k - 1] + 1;
         }
         y_bwd = x_bwd - k;
         // Follow diagonal as long as possible
         while ((x_bwd < area.N()) && (y_bwd < area.M()) &&
-               (area.ra(x_bwd) == area.rb(y_bwd))) {
+               area.rmatch(x_bwd, y_bwd)) {
           ++x_bwd;
           ++y_bwd;
         }
         // Store best position on this diagonal
-        V_bwd[TK(k)] = x_bwd;
+        V_bwd[k] = x_bwd;
 
         // Check if we crossed the forward move
         if (d > 0) {
           const auto rk = area.rdiagonal(k);
-          if (x_bwd >= (area.N() - V_fwd[TK(rk)])) {
-            Point top = area.abs_point_r(x_bwd, y_bwd);
+          const I rx = (rk >= -band && rk <= band) ? V_fwd[rk] : 0;
+          if (x_bwd >= (area.N() - rx)) {
+            BasicPoint<I> top = area.abs_point_r(x_bwd, y_bwd);
             if (area.contains_abs(top)) {
-              Point bottom = area.abs_point_r(px, px - k);
+              BasicPoint<I> bottom = area.abs_point_r(px, px - k);
               if (area.contains_abs(bottom)) {
                 return {StepRetStatus::SUCCESS, {top, bottom}};
               }
             }
           }
         }
+
         if (x_bwd >= area.N() && y_bwd >= area.M()) {
           return {StepRetStatus::EXHAUSTED, {{0, 0}, {0, 0}}};
         }
       }
       return {StepRetStatus::NEED_MORE, {{0, 0}, {0, 0}}};
-    });
-
-    const auto &[fstatus, tf] = ft.get();
-    const auto &[bstatus, tb] = bt.get();
-
-    if (fstatus == StepRetStatus::SUCCESS) {
-      return tf;
-    } else if (bstatus == StepRetStatus::SUCCESS) {
-      return tb;
-    } else if (fstatus == StepRetStatus::EXHAUSTED ||
-               bstatus == StepRetStatus::EXHAUSTED) {
-      assert(false);
-    }
-
-    if (ns_per_step > 0) {
-      if (area.N() > 2 && area.M() > 2) {
-        auto end_time = std::chrono::high_resolution_clock::now();
-        if (std::chrono::duration_cast<std::chrono::nanoseconds>(end_time -
-                                                                 start_time)
-                .count() > ns_per_step) {
-          auto n = std::max(static_cast<int_fast64_t>(1L), area.N() / 2);
-          auto m = std::max(static_cast<int_fast64_t>(1L), area.M() / 2);
-          const auto &[tlx, tly] = area.tl();
-          return {{tlx + n, tly + m}, {tlx + n + 1, tly + m + 1}};
-        }
-      }
-    }
-  }
-  assert(false); // This can't be
-  return {};
-}
-#else
-template <template <typename, typename...> typename C, typename K,
-          typename... Args>
-std::tuple<Point, Point> myers_middle_move(const Area<C, K> &area,
-                                           int_fast64_t ns_per_step) {
-  auto max{area.M() + area.N()};
-  std::vector<int_fast64_t> V_fwd{static_cast<int_fast64_t>(2 * max + 1), 0};
-  V_fwd.resize(2 * max + 1);
-  V_fwd[1] = 0;
-  assert(static_cast<int_fast64_t>(V_fwd.capacity()) ==
-         static_cast<int_fast64_t>(2 * max + 1));
-  int_fast64_t x_fwd{0}, y_fwd{0};
-
-  std::vector<int_fast64_t> V_bwd{static_cast<int_fast64_t>(2 * max + 1), 0};
-  V_bwd.resize(2 * max + 1);
-  V_bwd[1] = 0;
-  assert(static_cast<int_fast64_t>(V_bwd.capacity()) ==
-         static_cast<int_fast64_t>(2 * max + 1));
-  int_fast64_t x_bwd{0}, y_bwd{0};
-
-  auto start_time = std::chrono::high_resolution_clock::now();
-  for (int d{0}; d <= static_cast<int_fast64_t>(max); ++d) {
-    auto min_valid_k = -d + std::max(static_cast<int_fast64_t>(0l),
-                                     d - static_cast<int_fast64_t>(area.M())) *
-                                2;
-    auto max_valid_k = d - std::max(static_cast<int_fast64_t>(0l),
-                                    d - static_cast<int_fast64_t>(area.N())) *
-                               2;
-    // Forward step
-    bool at_dest{false};
-    int_fast64_t px{0};
-    for (int_fast64_t k = min_valid_k; k <= max_valid_k; k += 2) {
-      // Move downward or to the right
-      if (k == -d || ((k != d) && (V_fwd[TK(k - 1)] < V_fwd[TK(k + 1)]))) {
-        px = x_fwd = V_fwd[TK(k + 1)];
-      } else {
-        x_fwd = px = V_fwd[TK(k - 1)] + 1;
-      }
-      y_fwd = x_fwd - k;
-      // Follow diagonal as long as possible
-      while ((x_fwd < area.N()) && (y_fwd < area.M()) &&
-             (area.a(x_fwd) == area.b(y_fwd))) {
-        ++x_fwd;
-        ++y_fwd;
-      }
-      // Store best x position on this diagonal
-      V_fwd[TK(k)] = x_fwd;
-
-      // Check if we crossed the backward move
-      if (d > 0) {
-        const auto rk = area.rdiagonal(k);
-        if (x_fwd >= (area.N() - V_bwd[TK(rk)])) {
-          Point top = area.abs_point(px, px - k);
-          if (area.contains_abs(top)) {
-            Point bottom = area.abs_point(x_fwd, y_fwd);
-            if (area.contains_abs(bottom)) {
-              return {top, bottom};
-            }
-          }
-        }
-      }
+    };
 
-      if (x_fwd >= area.N() && y_fwd >= area.M()) {
-        at_dest = true;
-        break;
-      }
-    }
+    if constexpr (P::execution::concurrent) {
+      auto ft = std::async(forward_step);
+      auto bt = std::async(backward_step);
+      const auto &[fstatus, tf] = ft.get();
+      const auto &[bstatus, tb] = bt.get();
 
-    // Backward step
-    for (int_fast64_t k = min_valid_k; k <= max_valid_k; k += 2) {
-      // Move downward or to the right
-      if (k == -d || ((k != d) && (V_bwd[TK(k - 1)] < V_bwd[TK(k + 1)]))) {
-        px = x_bwd = V_bwd[TK(k + 1)];
-      } else {
-        x_bwd = px = V_bwd[TK(k - 1)] + 1;
-      }
-      y_bwd = x_bwd - k;
-      // Follow diagonal as long as possible
-      while ((x_bwd < area.N()) && (y_bwd < area.M()) &&
-             (area.ra(x_bwd) == area.rb(y_bwd))) {
-        ++x_bwd;
-        ++y_bwd;
+      if (fstatus == StepRetStatus::SUCCESS) {
+        return tf;
+      } else if (bstatus == StepRetStatus::SUCCESS) {
+        return tb;
+      } else if (fstatus == StepRetStatus::EXHAUSTED ||
+                 bstatus == StepRetStatus::EXHAUSTED) {
+        break;
       }
-      // Store best position on this diagonal
-      V_bwd[TK(k)] = x_bwd;
-
-      // Check if we crossed the forward move
-      if (d > 0) {
-        const auto rk = area.rdiagonal(k);
-        if (x_bwd >= (area.N() - V_fwd[TK(rk)])) {
-          Point top = area.abs_point_r(x_bwd, y_bwd);
-          if (area.contains_abs(top)) {
-            Point bottom = area.abs_point_r(px, px - k);
-            if (area.contains_abs(bottom)) {
-              return {top, bottom};
-            }
-          }
-        }
+    } else {
+      const auto &[fstatus, tf] = forward_step();
+      if (fstatus == StepRetStatus::SUCCESS) {
+        return tf;
+      } else if (fstatus == StepRetStatus::EXHAUSTED) {
+        break;
       }
-
-      if (x_bwd >= area.N() && y_bwd >= area.M()) {
-        at_dest = true;
+      const auto &[bstatus, tb] = backward_step();
+      if (bstatus == StepRetStatus::SUCCESS) {
+        return tb;
+      } else if (bstatus == StepRetStatus::EXHAUSTED) {
         break;
       }
     }
 
-    if (at_dest) {
-      break;
+    if constexpr (P::budget::controlled) {
+      if (control.expired()) {
+        // myers_moves replaces the whole area
+        return {area.tl(), area.tl()};
+      }
+      // The middle snake is found by step (N + M) / 2 at the latest
+      control.explore(area.cells() * static_cast<double>(d + 1) /
+                      static_cast<double>(max / 2 + 1));
     }
 
-    if (ns_per_step > 0) {
-      if (area.N() > 2 && area.M() > 2) {
-        auto end_time = std::chrono::high_resolution_clock::now();
-        if (std::chrono::duration_cast<std::chrono::nanoseconds>(end_time -
-                                                                 start_time)
-                .count() > ns_per_step) {
-          auto n = std::max(static_cast<int_fast64_t>(1L), area.N() / 2);
-          auto m = std::max(static_cast<int_fast64_t>(1L), area.M() / 2);
-          const auto &[tlx, tly] = area.tl();
-          return {{tlx + n, tly + m}, {tlx + n + 1, tly + m + 1}};
+    if constexpr (P::budget::enabled) {
+      if (ns_per_step > 0) {
+        if (area.N() > 2 && area.M() > 2) {
+          auto end_time = std::chrono::high_resolution_clock::now();
+          if (std::chrono::duration_cast<std::chrono::nanoseconds>(end_time -
+                                                                   start_time)
+                  .count() > ns_per_step) {
+            stats.timeout();
+            auto n = std::max(static_cast<I>(1L), area.N() / 2);
+            auto m = std::max(static_cast<I>(1L), area.M() / 2);
+            const auto &[tlx, tly] = area.tl();
+            return {{tlx + n, tly + m}, {tlx + n + 1, tly + m + 1}};
+          }
         }
       }
     }
@@ -481,12 +1085,12 @@ std::tuple<Point, Point> myers_middle_move(const Area<C, K> &area,
   assert(false); // This can't be
   return {};
 }
-#endif
 
-template <template <typename, typename...> typename C, typename K,
-          typename... Args>
-void myers_moves(Area<C, K> area, std::vector<Move<K>> &result,
-                 int_fast64_t ns_per_step) {
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename R, typename... Args>
+void myers_moves(Area<P, C, K, Args...> area, std::vector<Move<K, R>> &result,
+                 int_fast64_t ns_per_step, typename P::stats &stats,
+                 Control &control) {
   if (area.N() == 0 && area.M() == 0) {
     return;
   } else if (area.N() == 0) {
@@ -498,7 +1102,7 @@ void myers_moves(Area<C, K> area, std::vector<Move<K>> &result,
         return;
       }
     }
-    result.push_back(Move<K>{OP::INSERT, area.tl(), area.br(), {}});
+    result.push_back(Move<K, R>{OP::INSERT, area.tl(), area.br(), {}});
   } else if (area.M() == 0) {
     if (!result.empty()) {
       auto &last = result.back();
@@ -508,13 +1112,35 @@ void myers_moves(Area<C, K> area, std::vector<Move<K>> &result,
         return;
       }
     }
-    result.push_back(Move<K>{OP::DELETE, area.tl(), area.br(), {}});
+    result.push_back(Move<K, R>{OP::DELETE, area.tl(), area.br(), {}});
   } else {
-    auto middle = myers_middle_move(area, ns_per_step);
+    auto middle = myers_middle_move(area, ns_per_step, stats, control);
+    if constexpr (P::budget::controlled) {
+      control.explore(0);
+      if (control.expired()) {
+        // Give up: delete the whole area then insert the whole area
+        control.interrupt();
+        control.resolve(area.cells());
+        const BasicPoint<typename P::index> corner{std::get<0>(area.br()),
+                                                   std::get<1>(area.tl())};
+        myers_moves(Area{area, area.tl(), corner}, result, ns_per_step, stats,
+                    control);
+        myers_moves(Area{area, corner, area.br()}, result, ns_per_step, stats,
+                    control);
+        return;
+      }
+    }
     const auto &[top, bottom] = middle;
-    myers_moves(Area{area, area.tl(), top}, result, ns_per_step);
-    myers_moves(Area{area, top, bottom}, result, ns_per_step);
-    myers_moves(Area{area, bottom, area.br()}, result, ns_per_step);
+    Area first{area, area.tl(), top};
+    Area snake{area, top, bottom};
+    Area last{area, bottom, area.br()};
+    if constexpr (P::budget::controlled) {
+      control.resolve(area.cells() - first.cells() - snake.cells() -
+                      last.cells());
+    }
+    myers_moves(first, result, ns_per_step, stats, control);
+    myers_moves(snake, result, ns_per_step, stats, control);
+    myers_moves(last, result, ns_per_step, stats, control);
   }
 }
 
@@ -525,61 +1151,407 @@ template <typename P> void inner_swap(P &p) {
   py = temp;
 }
 
-template <template <typename, typename...> typename C, typename K,
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers(const C<K, Args...> &a, const C<K, Args...> &b,
+      int_fast64_t ns_per_step) {
+  typename P::stats stats;
+  return myers<P>(a, b, ns_per_step, stats);
+}
+
+template <typename P, template <typename, typename...> typename C, typename K,
           typename... Args>
-std::vector<Move<K>> myers(const C<K, Args...> &a, const C<K, Args...> &b,
-                           int_fast64_t ns_per_step) {
-  auto s = myers_unfilled(a, b, ns_per_step);
+std::vector<Move<K, typename P::move_index>>
+myers(const C<K, Args...> &a, const C<K, Args...> &b, int_fast64_t ns_per_step,
+      typename P::stats &stats) {
+  auto s = myers_unfilled<P>(a, b, ns_per_step, stats);
   myers_fill(b, s);
   return s;
 }
 
-template <template <typename, typename...> typename C, typename K,
+template <typename P, template <typename, typename...> typename C, typename K,
           typename... Args>
-std::vector<Move<K>> myers_unfilled(const C<K, Args...> &a,
-                                    const C<K, Args...> &b,
-                                    int_fast64_t ns_per_step) {
-#ifdef YAVOM_TRANSPOSE
-  const auto &int_fast64_test = a.size() > b.size() ? a : b;
-  const auto &shortest = a.size() > b.size() ? b : a;
-  bool reversed = (&int_fast64_test == &a);
-#else
-  const auto &int_fast64_test = b;
-  const auto &shortest = a;
-#endif
-  Area<C, K> all{shortest, int_fast64_test};
-  std::vector<Move<K>> s;
-  myers_moves(all, s, ns_per_step);
-#ifdef YAVOM_TRANSPOSE
-  std::for_each(s.begin(), s.end(),
-                [&int_fast64_test, &shortest, &reversed](auto &m) {
-                  auto &[m_op, m_s, m_t, v] = m;
-                  switch (m_op) {
-                  case OP::INSERT: {
-                    if (reversed) {
-                      m_op = OP::DELETE;
-                      inner_swap(m_s);
-                      inner_swap(m_t);
-                    }
-                    break;
-                  }
-                  case OP::DELETE: {
-                    if (reversed) {
-                      m_op = OP::INSERT;
-                      inner_swap(m_s);
-                      inner_swap(m_t);
-                    }
-                    break;
-                  }
-                  }
-                });
-#endif
+std::vector<Move<K, typename P::move_index>>
+myers(const C<K, Args...> &a, const C<K, Args...> &b, int_fast64_t ns_per_step,
+      typename P::stats &stats, Control &control) {
+  auto s = myers_unfilled<P>(a, b, ns_per_step, stats, control);
+  myers_fill(b, s);
+  return s;
+}
+
+// Runs myers on a worker thread with the Deadline budget: control can be used
+// to cancel the diff and to follow its progress. a, b and control must outlive
+// the returned future.
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::future<std::vector<Move<K, typename P::move_index>>>
+myers_async(const C<K, Args...> &a, const C<K, Args...> &b, Control &control,
+            int_fast64_t ns_per_step) {
+  using Controlled = typename P::template with_budget<Deadline>;
+  return std::async(std::launch::async, [&a, &b, &control, ns_per_step]() {
+    typename P::stats stats;
+    return myers<Controlled>(a, b, ns_per_step, stats, control);
+  });
+}
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_unfilled(const C<K, Args...> &a, const C<K, Args...> &b,
+               int_fast64_t ns_per_step) {
+  typename P::stats stats;
+  return myers_unfilled<P>(a, b, ns_per_step, stats);
+}
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename R, typename... Args>
+void myers_search(const C<K, Args...> &a, const C<K, Args...> &b,
+                  std::vector<Move<K, R>> &s, int_fast64_t ns_per_step,
+                  typename P::stats &stats, Control &control) {
+  const auto *shortest = &a;
+  const auto *longest = &b;
+  bool reversed{false};
+  if constexpr (P::transposition::enabled) {
+    if (a.size() > b.size()) {
+      std::swap(shortest, longest);
+      reversed = true;
+    }
+  }
+  Area<P, C, K, Args...> all{*shortest, *longest};
+  control.start(all.cells());
+  myers_moves(all, s, ns_per_step, stats, control);
+  if constexpr (P::transposition::enabled) {
+    if (reversed) {
+      transpose_moves(s);
+    }
+  }
+}
+
+// Turns moves from b to a into moves from a to b
+template <typename K, typename R>
+void transpose_moves(std::vector<Move<K, R>> &s) {
+  std::for_each(s.begin(), s.end(), [](auto &m) {
+    auto &[m_op, m_s, m_t, v] = m;
+    switch (m_op) {
+    case OP::INSERT: {
+      m_op = OP::DELETE;
+      inner_swap(m_s);
+      inner_swap(m_t);
+      break;
+    }
+    case OP::DELETE: {
+      m_op = OP::INSERT;
+      inner_swap(m_s);
+      inner_swap(m_t);
+      break;
+    }
+    default:
+      break;
+    }
+  });
+}
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_unfilled(const C<K, Args...> &a, const C<K, Args...> &b,
+               int_fast64_t ns_per_step, typename P::stats &stats) {
+  Control control;
+  return myers_unfilled<P>(a, b, ns_per_step, stats, control);
+}
+
+// control is only checked with the Deadline budget, but it is always marked
+// as finished at the end
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_unfilled(const C<K, Args...> &a, const C<K, Args...> &b,
+               int_fast64_t ns_per_step, typename P::stats &stats,
+               Control &control) {
+  std::vector<Move<K, typename P::move_index>> s;
+  with_fitting_index<P>(a.size(), b.size(), [&](auto policy) {
+    myers_search<decltype(policy)>(a, b, s, ns_per_step, stats, control);
+  });
+  control.finish();
+  return s;
+}
+
+// Chunk boundaries are placed where the top bits of a gear hash of the
+// element hashes are clear: the gear hash only depends on the last 64
+// elements, so that an edit moves the boundaries of its own chunk only.
+// Chunks hold at least block_size / 4 and at most 4 * block_size elements.
+template <template <typename, typename...> typename C, typename K, typename I,
+          typename... Args>
+std::vector<Chunk<I>> content_chunks(const C<K, Args...> &c, I first, I last,
+                                     std::size_t block_size) {
+  unsigned bits{0};
+  while (bits < 63 && (std::size_t{1} << bits) < block_size) {
+    ++bits;
+  }
+  const auto min_size{static_cast<I>(std::max<std::size_t>(block_size / 4, 1))};
+  const auto max_size{static_cast<I>(std::max<std::size_t>(block_size * 4, 1))};
+  std::vector<Chunk<I>> chunks;
+  chunks.reserve(static_cast<std::size_t>(last - first) /
+                     std::max<std::size_t>(block_size, 1) +
+                 1);
+  I begin{first};
+  std::uint64_t gear{0}, fingerprint{0xcbf29ce484222325ULL};
+  for (I i{first}; i < last; ++i) {
+    const std::uint64_t h{std::hash<K>{}(c[i])};
+    gear = (gear << 1) + h * 0x9e3779b97f4a7c15ULL;
+    fingerprint = (fingerprint ^ h) * 0x100000001b3ULL;
+    fingerprint ^= fingerprint >> 32;
+    const I size{i + 1 - begin};
+    if ((size >= min_size && (bits == 0 || (gear >> (64 - bits)) == 0)) ||
+        size >= max_size || i + 1 == last) {
+      fingerprint ^= static_cast<std::uint64_t>(size) * 0xc2b2ae3d27d4eb4fULL;
+      chunks.push_back({begin, i + 1, fingerprint});
+      begin = i + 1;
+      fingerprint = 0xcbf29ce484222325ULL;
+    }
+  }
+  return chunks;
+}
+
+// Coarse alignment: chunks whose fingerprint occurs exactly once in a and
+// once in b are paired, the longest chain of pairs that is increasing in
+// both containers is kept (patience sorting) and the exact search only runs
+// in the gaps between chained chunks. Pairs are compared element by element
+// before they are trusted, so fingerprint collisions only cost alignment.
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename R, typename... Args>
+void myers_coarse_search(const C<K, Args...> &a, const C<K, Args...> &b,
+                         std::vector<Move<K, R>> &s, int_fast64_t ns_per_step,
+                         std::size_t block_size, typename P::stats &stats,
+                         Control &control) {
+  using I = typename P::index;
+  if constexpr (P::transposition::enabled) {
+    if (a.size() > b.size()) {
+      using Q = Policy<typename P::execution, NoTranspose, typename P::equal,
+                       typename P::budget, typename P::stats, I>;
+      myers_coarse_search<Q>(b, a, s, ns_per_step, block_size, stats, control);
+      transpose_moves(s);
+      return;
+    }
+  }
+  Area<P, C, K, Args...> all{a, b};
+  const auto &[tlx, tly] = all.tl();
+  const auto &[brx, bry] = all.br();
+  const auto ca = content_chunks(a, tlx, brx, block_size);
+  const auto cb = content_chunks(b, tly, bry, block_size);
+
+  // Occurrences in a and in b, and index of the last one
+  std::unordered_map<std::uint64_t, std::tuple<I, I, I, I>> seen;
+  seen.reserve(ca.size() + cb.size());
+  for (std::size_t i{0}; i < ca.size(); ++i) {
+    auto &[na, ia, nb, ib] = seen[std::get<2>(ca[i])];
+    ++na;
+    ia = static_cast<I>(i);
+  }
+  for (std::size_t i{0}; i < cb.size(); ++i) {
+    auto &[na, ia, nb, ib] = seen[std::get<2>(cb[i])];
+    ++nb;
+    ib = static_cast<I>(i);
+  }
+  // Unique pairs sorted by chunk of a
+  std::vector<std::tuple<I, I>> pairs;
+  for (const auto &chunk : ca) {
+    const auto &[na, ia, nb, ib] = seen[std::get<2>(chunk)];
+    if (na == 1 && nb == 1) {
+      pairs.push_back({ia, ib});
+    }
+  }
+
+  // Longest increasing chain of chunks of b
+  constexpr auto none{std::numeric_limits<std::size_t>::max()};
+  std::vector<std::size_t> tails;
+  std::vector<std::size_t> previous(pairs.size(), none);
+  for (std::size_t i{0}; i < pairs.size(); ++i) {
+    auto pos = std::lower_bound(tails.begin(), tails.end(),
+                                std::get<1>(pairs[i]),
+                                [&pairs](std::size_t t, I ib) {
+                                  return std::get<1>(pairs[t]) < ib;
+                                });
+    if (pos != tails.begin()) {
+      previous[i] = *(pos - 1);
+    }
+    if (pos == tails.end()) {
+      tails.push_back(i);
+    } else {
+      *pos = i;
+    }
+  }
+  std::vector<std::tuple<I, I>> chain;
+  for (auto i = tails.empty() ? none : tails.back(); i != none;
+       i = previous[i]) {
+    chain.push_back(pairs[i]);
+  }
+  std::reverse(chain.begin(), chain.end());
+
+  // Gaps around the chunks that are actually equal
+  std::vector<std::tuple<BasicPoint<I>, BasicPoint<I>>> gaps;
+  BasicPoint<I> from{all.tl()};
+  for (const auto &[ia, ib] : chain) {
+    const auto &[a0, a1, fa] = ca[static_cast<std::size_t>(ia)];
+    const auto &[b0, b1, fb] = cb[static_cast<std::size_t>(ib)];
+    if (a1 - a0 == b1 - b0 &&
+        std::equal(a.begin() + a0, a.begin() + a1, b.begin() + b0,
+                   typename P::equal{})) {
+      gaps.push_back({from, BasicPoint<I>{a0, b0}});
+      from = BasicPoint<I>{a1, b1};
+    }
+  }
+  gaps.push_back({from, all.br()});
+
+  double cells{0};
+  if constexpr (P::budget::controlled) {
+    for (const auto &[tl, br] : gaps) {
+      cells += Area<P, C, K, Args...>{all, tl, br}.cells();
+    }
+  }
+  control.start(cells);
+  for (const auto &[tl, br] : gaps) {
+    myers_moves(Area<P, C, K, Args...>{all, tl, br}, s, ns_per_step, stats,
+                control);
+  }
+}
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_coarse_unfilled(const C<K, Args...> &a, const C<K, Args...> &b,
+                      int_fast64_t ns_per_step, std::size_t block_size) {
+  std::vector<Move<K, typename P::move_index>> s;
+  typename P::stats stats;
+  Control control;
+  with_fitting_index<P>(a.size(), b.size(), [&](auto policy) {
+    myers_coarse_search<decltype(policy)>(a, b, s, ns_per_step, block_size,
+                                          stats, control);
+  });
+  control.finish();
+  return s;
+}
+
+template <typename P, template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_coarse(const C<K, Args...> &a, const C<K, Args...> &b,
+             int_fast64_t ns_per_step, std::size_t block_size) {
+  auto s = myers_coarse_unfilled<P>(a, b, ns_per_step, block_size);
+  myers_fill(b, s);
   return s;
 }
 
-template <template <typename, typename...> typename C, typename K,
+// Length of the run of equal elements of a from x and of b from y. Integral
+// elements compared with std::equal_to are first compared by blocks of 32,
+// OR-ing the XOR of each pair: the block loop has no early exit, so the
+// compiler vectorises it (and 32 iterations are not fully unrolled first).
+template <typename Equal, template <typename, typename...> typename C,
+          typename K, typename I, typename... Args>
+auto common_run(const C<K, Args...> &a, I x, I N, const C<K, Args...> &b, I y,
+                I M) -> I {
+  const auto limit{std::min(N - x, M - y)};
+  I length{0};
+  if constexpr (std::is_integral_v<K> &&
+                (std::is_same_v<Equal, std::equal_to<>> ||
+                 std::is_same_v<Equal, std::equal_to<K>>)) {
+    constexpr I block{32};
+    while (length + block <= limit) {
+      K different{0};
+      for (I i{0}; i < block; ++i) {
+        different |= static_cast<K>(a[x + length + i] ^ b[y + length + i]);
+      }
+      if (different != 0) {
+        break;
+      }
+      length += block;
+    }
+  }
+  while (length < limit && Equal{}(a[x + length], b[y + length])) {
+    ++length;
+  }
+  return length;
+}
+
+// Merge walk of a and b, both sorted by Less: the longest common subsequence
+// of two sorted containers is their multiset intersection, so the script is
+// minimal in O(N + M). Each mismatching run between two common runs becomes
+// a single DELETE followed by a single INSERT. Runs of deletions or
+// insertions are skipped by galloping search and common runs are compared
+// with common_run. Elements that are equivalent under Less but not equal
+// under P::equal are replaced.
+template <typename P, typename Less,
+          template <typename, typename...> typename C, typename K,
           typename... Args>
-void myers_fill(const C<K, Args...> &b, std::vector<Move<K>> &s) {
+std::vector<Move<K, typename P::move_index>>
+myers_sorted_unfilled(const C<K, Args...> &a, const C<K, Args...> &b) {
+  using I = typename P::move_index;
+  assert(index_fits<I>(a.size(), b.size()));
+  assert(std::is_sorted(a.begin(), a.end(), Less{}));
+  assert(std::is_sorted(b.begin(), b.end(), Less{}));
+  const auto N{static_cast<I>(a.size())};
+  const auto M{static_cast<I>(b.size())};
+  // First index in [first, last) of c that is not before value
+  auto gallop = [](const C<K, Args...> &c, I first, I last, const K &value) {
+    I step{1};
+    I low{first};
+    while (first + step < last && Less{}(c[first + step], value)) {
+      low = first + step;
+      step *= 2;
+    }
+    const I high{std::min<I>(first + step, last)};
+    return static_cast<I>(
+        std::lower_bound(c.begin() + low, c.begin() + high, value, Less{}) -
+        c.begin());
+  };
+  std::vector<Move<K, I>> s;
+  // Start of the current mismatching run
+  I x0{0}, y0{0};
+  auto flush = [&s, &x0, &y0](I x, I y) {
+    if (x > x0) {
+      s.push_back(Move<K, I>{OP::DELETE, {x0, y0}, {x, y0}, {}});
+    }
+    if (y > y0) {
+      s.push_back(Move<K, I>{OP::INSERT, {x, y0}, {x, y}, {}});
+    }
+  };
+  I x{0}, y{0};
+  while (x < N && y < M) {
+    if (Less{}(a[x], b[y])) {
+      x = gallop(a, x, N, b[y]);
+    } else if (Less{}(b[y], a[x])) {
+      y = gallop(b, y, M, a[x]);
+    } else {
+      const auto common{common_run<typename P::equal>(a, x, N, b, y, M)};
+      if (common == 0) {
+        ++x;
+        continue;
+      }
+      flush(x, y);
+      x += common;
+      y += common;
+      x0 = x;
+      y0 = y;
+    }
+  }
+  flush(N, M);
+  return s;
+}
+
+template <typename P, typename Less,
+          template <typename, typename...> typename C, typename K,
+          typename... Args>
+std::vector<Move<K, typename P::move_index>>
+myers_sorted(const C<K, Args...> &a, const C<K, Args...> &b) {
+  auto s = myers_sorted_unfilled<P, Less>(a, b);
+  myers_fill(b, s);
+  return s;
+}
+
+template <template <typename, typename...> typename C, typename K, typename I,
+          typename... Args>
+void myers_fill(const C<K, Args...> &b, std::vector<Move<K, I>> &s) {
   std::for_each(s.begin(), s.end(), [&b](auto &m) {
     auto &[m_op, m_s, m_t, v] = m;
     switch (m_op) {
@@ -599,7 +1571,8 @@ void myers_fill(const C<K, Args...> &b, std::vector<Move<K>> &s) {
 // For OP::_DELETE save and restore only m_s (count, start)
 // For OP::INSERT only the second coordinate in m_s and the vector need to be
 // saved and restored
-template <typename K> void myers_strip_moves(std::vector<Move<K>> &s) {
+template <typename K, typename I>
+void myers_strip_moves(std::vector<Move<K, I>> &s) {
   for (auto &m : s) {
     auto &[m_op, m_s, m_t, v] = m;
     switch (m_op) {
@@ -615,6 +1588,319 @@ template <typename K> void myers_strip_moves(std::vector<Move<K>> &s) {
   }
 }
 
+// Reverse of a filled, stripped or unfilled script from a to b: the result
+// turns b back into a. INSERT and DELETE are swapped along with their
+// coordinates, as with transposition, and deleted elements are copied from a.
+// Only the positions are read, the first coordinate is recomputed from the
+// running difference between a and b. The length of an INSERT is the size of
+// its data, or the span of its points when it was not filled.
+template <template <typename, typename...> typename C, typename K, typename I,
+          typename... Args>
+std::vector<Move<K, I>> invert(const std::vector<Move<K, I>> &s,
+                               const C<K, Args...> &a) {
+  std::vector<Move<K, I>> r;
+  r.reserve(s.size());
+  // x - y at the current position
+  I offset{0};
+  for (const auto &[m_op, m_s, m_t, v] : s) {
+    const auto y{std::get<1>(m_s)};
+    const auto x{y + offset};
+    switch (m_op) {
+    case OP::DELETE:
+    case OP::_DELETE: {
+      const auto count{m_op == OP::DELETE
+                           ? std::get<0>(m_t) - std::get<0>(m_s)
+                           : std::get<0>(m_s)};
+      r.push_back(Move<K, I>{OP::INSERT,
+                             {y, x},
+                             {y, x + count},
+                             {a.begin() + x, a.begin() + x + count}});
+      offset += count;
+      break;
+    }
+    case OP::INSERT: {
+      const auto count{v.empty() ? std::get<1>(m_t) - std::get<1>(m_s)
+                                 : static_cast<I>(v.size())};
+      r.push_back(Move<K, I>{OP::DELETE, {y, x}, {y + count, x}, {}});
+      offset -= count;
+      break;
+    }
+    }
+  }
+  return r;
+}
+
+// Line level diff followed by a token level diff of each pair of lines
+// replaced by adjacent DELETE and INSERT moves (in either order). Line i of
+// the DELETE is paired with line i of the INSERT, the remaining lines are
+// left as they are. Refinements are computed concurrently with the Async
+// execution policy. With WordTokens the inserted tokens refer to the lines
+// of b.
+template <typename P, typename T, template <typename, typename...> typename C,
+          typename S, typename... Args>
+std::tuple<std::vector<Move<S, typename P::move_index>>,
+           std::vector<Refinement<TokenOf<T, S>, typename P::move_index>>>
+myers_refined(const C<S, Args...> &a, const C<S, Args...> &b,
+              int_fast64_t ns_per_step) {
+  using I = typename P::move_index;
+  // Lines are short: refine each pair sequentially and with plain equality
+  using Inner = Policy<Sequential, NoTranspose, std::equal_to<>,
+                       typename P::budget, NoStats, typename P::index>;
+  auto lines = myers<P>(a, b, ns_per_step);
+  std::vector<Refinement<TokenOf<T, S>, I>> refinements;
+  for (std::size_t i{1}; i < lines.size(); ++i) {
+    const auto *del = &lines[i - 1];
+    const auto *ins = &lines[i];
+    if (std::get<0>(*del) == OP::INSERT) {
+      std::swap(del, ins);
+    }
+    const auto &[d_op, d_s, d_t, d_v] = *del;
+    const auto &[i_op, i_s, i_t, i_v] = *ins;
+    if (d_op != OP::DELETE || i_op != OP::INSERT ||
+        std::get<2>(lines[i - 1]) != std::get<1>(lines[i])) {
+      continue;
+    }
+    auto count{std::min(std::get<0>(d_t) - std::get<0>(d_s),
+                        std::get<1>(i_t) - std::get<1>(i_s))};
+    for (I j{0}; j < count; ++j) {
+      refinements.push_back({std::get<0>(d_s) + j, std::get<1>(i_s) + j, {}});
+    }
+    // Each move belongs to at most one pair
+    ++i;
+  }
+
+  auto refine = [&a, &b, &refinements, ns_per_step](std::size_t first,
+                                                     std::size_t last) {
+    for (auto i{first}; i < last; ++i) {
+      auto &[a_index, b_index, moves] = refinements[i];
+      const auto ta = T::tokens(a[a_index]);
+      const auto tb = T::tokens(b[b_index]);
+      moves = myers<Inner>(ta, tb, ns_per_step);
+    }
+  };
+  if constexpr (P::execution::concurrent) {
+    const std::size_t tasks{std::max(1u, std::thread::hardware_concurrency())};
+    const auto chunk{(refinements.size() + tasks - 1) / tasks};
+    std::vector<std::future<void>> futures;
+    for (std::size_t first{0}; first < refinements.size(); first += chunk) {
+      const auto last{std::min(refinements.size(), first + chunk)};
+      futures.push_back(std::async(std::launch::async, refine, first, last));
+    }
+    for (auto &f : futures) {
+      f.get();
+    }
+  } else {
+    refine(0, refinements.size());
+  }
+  return {std::move(lines), std::move(refinements)};
+}
+
+// Hashes a then b in a single pass, element hashes (H, std::hash<K> by
+// default) are mixed into two independent 64-bit lanes. Sizes are mixed too,
+// so that moving elements from the end of a to the start of b changes the
+// digest.
+template <typename H, template <typename, typename...> typename C, typename K,
+          typename... Args>
+Digest content_digest(const C<K, Args...> &a, const C<K, Args...> &b) {
+  using Hash = std::conditional_t<std::is_void_v<H>, std::hash<K>, H>;
+  std::uint64_t lo{0x243f6a8885a308d3ULL}, hi{0x13198a2e03707344ULL};
+  auto mix = [&lo, &hi](std::uint64_t h) {
+    lo = (lo ^ h) * 0x9e3779b97f4a7c15ULL;
+    lo ^= lo >> 32;
+    hi = (hi + h) * 0xc2b2ae3d27d4eb4fULL;
+    hi ^= hi >> 29;
+  };
+  mix(a.size());
+  for (const auto &x : a) {
+    mix(Hash{}(x));
+  }
+  mix(b.size());
+  for (const auto &x : b) {
+    mix(Hash{}(x));
+  }
+  return {lo, hi};
+}
+
+// Cache of edit scripts keyed by the content digest of (a, b) and by the time
+// limit, shared by concurrent callers: a script computed with a time limit
+// (which may not be minimal) is never returned for an exact diff. Scripts are
+// stored without insert data (OP and points only) and filled from b on each
+// hit. Elements left untouched by the script are compared on each hit, so
+// digest collisions are detected and count as misses. At most capacity moves
+// are stored, an empty script counting as one move so that identical pairs
+// are evicted too. Least recently used scripts are evicted first.
+template <typename K, typename P = DefaultPolicy, typename H = std::hash<K>>
+class Cache {
+public:
+  using I = typename P::move_index;
+  using Script = std::vector<std::tuple<OP, BasicPoint<I>, BasicPoint<I>>>;
+
+  explicit Cache(std::size_t capacity) : m_capacity{capacity} {}
+
+  template <template <typename, typename...> typename C, typename... Args>
+  auto myers(const C<K, Args...> &a, const C<K, Args...> &b,
+             int_fast64_t ns_per_step = -1) -> std::vector<Move<K, I>> {
+    auto s = myers_unfilled(a, b, ns_per_step);
+    myers_fill(b, s);
+    return s;
+  }
+
+  template <template <typename, typename...> typename C, typename... Args>
+  auto myers_unfilled(const C<K, Args...> &a, const C<K, Args...> &b,
+                      int_fast64_t ns_per_step = -1)
+      -> std::vector<Move<K, I>> {
+    const bool limited{P::budget::enabled && ns_per_step > 0};
+    const Key key{content_digest<H>(a, b), limited ? ns_per_step : -1};
+    std::vector<Move<K, I>> s;
+    bool found{false};
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      auto entry = m_index.find(key);
+      if (entry != m_index.end()) {
+        m_lru.splice(m_lru.begin(), m_lru, entry->second);
+        s = expand(std::get<1>(*entry->second));
+        found = true;
+      }
+    }
+    const bool hit{found && untouched_equal(s, a, b)};
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      if (hit) {
+        ++m_hits;
+        return s;
+      }
+      ++m_misses;
+      if (found) {
+        // Digest collision: replace the entry
+        erase(key);
+      }
+    }
+    // Concurrent misses on the same pair compute it more than once
+    s = yavom::myers_unfilled<P>(a, b, ns_per_step);
+    store(key, s);
+    return s;
+  }
+
+  auto hits() const -> std::size_t {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    return m_hits;
+  }
+
+  auto misses() const -> std::size_t {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    return m_misses;
+  }
+
+  // Number of stored moves (at least one per script)
+  auto size() const -> std::size_t {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    return m_size;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_lru.clear();
+    m_index.clear();
+    m_size = 0;
+  }
+
+private:
+  // Content digest and time limit (-1 for exact scripts)
+  using Key = std::tuple<Digest, int_fast64_t>;
+
+  struct KeyHash {
+    auto operator()(const Key &key) const noexcept -> std::size_t {
+      const auto &[d, ns_per_step] = key;
+      return static_cast<std::size_t>(std::get<0>(d) ^ std::get<1>(d) ^
+                                      static_cast<std::uint64_t>(ns_per_step));
+    }
+  };
+
+  using Entry = std::tuple<Key, Script>;
+
+  // True if the elements that s leaves untouched are equal in a and b, that
+  // is if s turns a into b
+  template <template <typename, typename...> typename C, typename... Args>
+  static auto untouched_equal(const std::vector<Move<K, I>> &s,
+                              const C<K, Args...> &a, const C<K, Args...> &b)
+      -> bool {
+    auto equal_run = [&a, &b](BasicPoint<I> from, BasicPoint<I> to) {
+      const auto &[fx, fy] = from;
+      const auto &[tx, ty] = to;
+      return tx >= fx && tx - fx == ty - fy &&
+             tx <= static_cast<I>(a.size()) && ty <= static_cast<I>(b.size()) &&
+             std::equal(a.begin() + fx, a.begin() + tx, b.begin() + fy,
+                        typename P::equal{});
+    };
+    BasicPoint<I> from{0, 0};
+    for (const auto &[op, m_s, m_t, v] : s) {
+      if (!equal_run(from, m_s) || std::get<0>(m_t) < std::get<0>(m_s) ||
+          std::get<1>(m_t) < std::get<1>(m_s)) {
+        return false;
+      }
+      from = m_t;
+    }
+    return equal_run(from, BasicPoint<I>{static_cast<I>(a.size()),
+                                         static_cast<I>(b.size())});
+  }
+
+  // Called with the mutex held
+  void erase(const Key &key) {
+    auto entry = m_index.find(key);
+    if (entry != m_index.end()) {
+      m_size -= cost(std::get<1>(*entry->second));
+      m_lru.erase(entry->second);
+      m_index.erase(entry);
+    }
+  }
+
+  // Share of the capacity used by a script
+  static auto cost(const Script &script) noexcept -> std::size_t {
+    return std::max<std::size_t>(1, script.size());
+  }
+
+  static auto expand(const Script &script) -> std::vector<Move<K, I>> {
+    std::vector<Move<K, I>> s;
+    s.reserve(script.size());
+    for (const auto &[op, from, to] : script) {
+      s.push_back(Move<K, I>{op, from, to, {}});
+    }
+    return s;
+  }
+
+  void store(const Key &key, const std::vector<Move<K, I>> &s) {
+    if (std::max<std::size_t>(1, s.size()) > m_capacity) {
+      return;
+    }
+    Script script;
+    script.reserve(s.size());
+    for (const auto &[op, from, to, v] : s) {
+      script.emplace_back(op, from, to);
+    }
+    std::lock_guard<std::mutex> lock{m_mutex};
+    if (m_index.find(key) != m_index.end()) {
+      return;
+    }
+    while (m_size + cost(script) > m_capacity) {
+      m_size -= cost(std::get<1>(m_lru.back()));
+      m_index.erase(std::get<0>(m_lru.back()));
+      m_lru.pop_back();
+    }
+    m_size += cost(script);
+    m_lru.emplace_front(key, std::move(script));
+    m_index.emplace(key, m_lru.begin());
+  }
+
+  mutable std::mutex m_mutex;
+  std::list<Entry> m_lru;
+  std::unordered_map<Key, typename std::list<Entry>::iterator, KeyHash>
+      m_index;
+  std::size_t m_capacity{0};
+  std::size_t m_size{0};
+  std::size_t m_hits{0};
+  std::size_t m_misses{0};
+};
+
 } // namespace yavom
 } // namespace orgsyscall
 
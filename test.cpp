@@ -270,6 +270,397 @@ auto main() -> int
                 }
             }
         }
+        {
+            std::string basePath{"./testdata/"};
+            auto files = {"alpha", "ban", "ben", "beta", "delta", "empty", "first", "gamma", "second", "test1", "test2", "third", "x", "y"};
+            for(const auto& fa : files) {
+                for (const auto& fb : files) {
+                    std::cerr << "Comparing (policies) " << fa << " with " << fb << "...";
+                    auto a = readFile(basePath+ fa);
+                    auto b = readFile(basePath+ fb);
+                    BasicStats stats;
+                    auto sequential = myers<Policy<Sequential, NoTranspose, std::equal_to<>, NoTimeLimit, BasicStats>>(a, b, -1, stats);
+                    auto async = myers<Policy<Async>>(a, b);
+                    auto transposed = myers<Policy<Sequential, Transpose>>(a, b);
+                    std::cerr << " " << stats.steps << " steps...";
+                    auto x = a;
+                    auto y = a;
+                    auto z = a;
+                    for (const auto& m : sequential) {
+                        apply_move(m, x);
+                    }
+                    for (const auto& m : async) {
+                        apply_move(m, y);
+                    }
+                    for (const auto& m : transposed) {
+                        apply_move(m, z);
+                    }
+                    if (!compare(x,b) || !compare(y,b) || !compare(z,b)) {
+                        std::cerr << " fail!\n";
+                    }
+                    else {
+                        std::cerr << " success!\n";
+                    }
+                }
+            }
+        }
+        {
+            std::string basePath{"./testdata/"};
+            auto files = {"alpha", "ban", "ben", "beta", "delta", "empty", "first", "gamma", "second", "test1", "test2", "third", "x", "y"};
+            for(const auto& fa : files) {
+                for (const auto& fb : files) {
+                    std::cerr << "Comparing (narrow index) " << fa << " with " << fb << "...";
+                    auto a = readFile(basePath+ fa);
+                    auto b = readFile(basePath+ fb);
+                    auto moves = myers_unfilled<Policy<Sequential, NoTranspose, std::equal_to<>, StepTimeLimit, NoStats, int32_t>>(a, b);
+                    std::cerr << moves.size() << " moves...";
+                    myers_fill(b, moves);
+                    myers_strip_moves(moves);
+                    std::cerr << " filled...";
+                    for (const auto& m : moves) {
+                        apply_move(m, a);
+                    }
+                    if (!compare(a,b)) {
+                        std::cerr << " fail!\n";
+                    }
+                    else {
+                        std::cerr << " success!\n";
+                    }
+                }
+            }
+        }
+        {
+            std::string basePath{"./testdata/"};
+            auto files = {"alpha", "ban", "ben", "beta", "delta", "empty", "first", "gamma", "second", "test1", "test2", "third", "x", "y"};
+            for(const auto& fa : files) {
+                for (const auto& fb : files) {
+                    std::cerr << "Comparing (refined) " << fa << " with " << fb << "...";
+                    auto a = readFile(basePath+ fa);
+                    auto b = readFile(basePath+ fb);
+                    auto [lines, refinements] = myers_refined<Policy<Async>>(a, b);
+                    std::cerr << refinements.size() << " refinements...";
+                    bool refined{true};
+                    for (const auto& [ai, bi, moves] : refinements) {
+                        auto line = a[ai];
+                        for (const auto& m : moves) {
+                            apply_move(m, line);
+                        }
+                        refined = refined && line == b[bi];
+                    }
+                    for (const auto& m : lines) {
+                        apply_move(m, a);
+                    }
+                    if (!compare(a,b) || !refined) {
+                        std::cerr << " fail!\n";
+                    }
+                    else {
+                        std::cerr << " success!\n";
+                    }
+                }
+            }
+        }
+        {
+            std::cerr << "Comparing (refined) line pairs...";
+            std::vector<std::string> a{"hello world foo", "abc def", "same", "x y z"};
+            std::vector<std::string> b{"hello there foo", "abd deg", "same", "x  q z"};
+            auto [lines, refinements] = myers_refined<DefaultPolicy, WordTokens>(a, b);
+            std::vector<std::tuple<int_fast64_t, int_fast64_t>> pairs;
+            for (const auto& [ai, bi, moves] : refinements) {
+                pairs.push_back({ai, bi});
+            }
+            std::vector<std::tuple<int_fast64_t, int_fast64_t>> expected{{0, 0}, {1, 1}, {3, 3}};
+            if (pairs != expected) {
+                std::cerr << " fail!\n";
+            }
+            else {
+                std::cerr << " success!\n";
+            }
+        }
+        {
+            std::string basePath{"./testdata/"};
+            auto files = {"alpha", "ban", "ben", "beta", "delta", "empty", "first", "gamma", "second", "test1", "test2", "third", "x", "y"};
+            Cache<std::string> cache{1'000'000};
+            for (auto round{0}; round < 2; ++round) {
+                for(const auto& fa : files) {
+                    for (const auto& fb : files) {
+                        std::cerr << "Comparing (cached) " << fa << " with " << fb << "...";
+                        auto a = readFile(basePath+ fa);
+                        auto b = readFile(basePath+ fb);
+                        auto moves = cache.myers(a, b);
+                        for (const auto& m : moves) {
+                            apply_move(m, a);
+                        }
+                        if (!compare(a,b)) {
+                            std::cerr << " fail!\n";
+                        }
+                        else {
+                            std::cerr << " success!\n";
+                        }
+                    }
+                }
+            }
+            std::cerr << "Cache hits " << cache.hits() << ", misses " << cache.misses() << "...";
+            if (cache.hits() != cache.misses()) {
+                std::cerr << " fail!\n";
+            }
+            else {
+                std::cerr << " success!\n";
+            }
+        }
+        {
+            std::cerr << "Comparing (cached) identical pairs eviction...";
+            Cache<int_fast64_t> cache{10};
+            for (auto round{0}; round < 2; ++round) {
+                for (int_fast64_t x{0}; x < 1000; ++x) {
+                    std::vector<int_fast64_t> a{x, x + 1};
+                    cache.myers(a, a);
+                }
+            }
+            if (cache.hits() != 0 || cache.misses() != 2000 || cache.size() != 10) {
+                std::cerr << " fail!\n";
+            }
+            else {
+                std::cerr << " success!\n";
+            }
+        }
+        {
+            std::cerr << "Comparing (cached) collisions and time limits...";
+            // Every element hashes to 0: the digest only depends on the sizes
+            struct ZeroHash {
+                auto operator()(int_fast64_t) const -> std::size_t { return 0; }
+            };
+            Cache<int_fast64_t, DefaultPolicy, ZeroHash> cache{1000};
+            std::vector<int_fast64_t> a{1, 2, 3, 4};
+            std::vector<int_fast64_t> b{4, 3, 2, 1};
+            std::vector<int_fast64_t> c{1, 3, 2, 4};
+            auto ab = cache.myers(a, b);
+            // Same digest as (a, b): the stored script does not apply
+            auto ac = cache.myers(a, c);
+            auto hit = cache.myers(a, c);
+            // Time limited scripts are stored apart from exact ones
+            auto limited = cache.myers(a, c, 1000);
+            auto ta = a;
+            auto tc = a;
+            auto th = a;
+            apply_moves(ab, ta);
+            apply_moves(ac, tc);
+            apply_moves(hit, th);
+            if (!compare(ta,b) || !compare(tc,c) || !compare(th,c) || cache.hits() != 1 || cache.misses() != 3) {
+                std::cerr << " fail!\n";
+            }
+            else {
+                std::cerr << " success!\n";
+            }
+        }
+        {
+            std::string basePath{"./testdata/"};
+            auto files = {"alpha", "ban", "ben", "beta", "delta", "empty", "first", "gamma", "second", "test1", "test2", "third", "x", "y"};
+            for(const auto& fa : files) {
+                for (const auto& fb : files) {
+                    std::cerr << "Comparing (rope) " << fa << " with " << fb << "...";
+                    auto a = readFile(basePath+ fa);
+                    auto b = readFile(basePath+ fb);
+                    auto moves = myers(a, b);
+                    Rope<std::string> rope{a};
+                    apply_moves(moves, rope);
+                    myers_strip_moves(moves);
+                    apply_moves(moves, a);
+                    if (!compare(a,b) || !compare(rope.flatten(),b)) {
+                        std::cerr << " fail!\n";
+                    }
+                    else {
+                        std::cerr << " success!\n";
+                    }
+                }
+            }
+        }
+        {
+            std::cerr << "Comparing (rope) random edits with vector...";
+            std::vector<int_fast64_t> a;
+            for (int_fast64_t x{0}; x < 200000; ++x) {
+                a.push_back(x);
+            }
+            Rope<int_fast64_t> rope{a};
+            std::uint32_t seed{12345};
+            auto next = [&seed](std::size_t n) {
+                seed = seed * 1664525u + 1013904223u;
+                return static_cast<std::size_t>(seed >> 8) % n;
+            };
+            for (int_fast64_t e{0}; e < 4000; ++e) {
+                const auto pos = next(a.size());
+                if (e % 2) {
+                    const auto count = std::min<std::size_t>(next(16), a.size() - pos);
+                    a.erase(a.begin() + pos, a.begin() + pos + count);
+                    rope.erase(pos, count);
+                }
+                else {
+                    std::vector<int_fast64_t> v(next(16) + 1, -e);
+                    a.insert(a.begin() + pos, v.begin(), v.end());
+                    rope.insert(pos, v.begin(), v.end());
+                }
+            }
+            if (!compare(rope.flatten(),a) || rope.size() != a.size() || rope[a.size() / 2] != a[a.size() / 2]) {
+                std::cerr << " fail!\n";
+            }
+            else {
+                std::cerr << " success!\n";
+            }
+        }
+        {
+            std::string basePath{"./testdata/"};
+            auto files = {"alpha", "ban", "ben", "beta", "delta", "empty", "first", "gamma", "second", "test1", "test2", "third", "x", "y"};
+            for(const auto& fa : files) {
+                for (const auto& fb : files) {
+                    std::cerr << "Comparing (deadline) " << fa << " with " << fb << "...";
+                    auto a = readFile(basePath+ fa);
+                    auto b = readFile(basePath+ fb);
+                    Control control{std::chrono::milliseconds(1)};
+                    auto moves = myers_async(a, b, control).get();
+                    std::cerr << moves.size() << " moves" << (control.interrupted() ? " (interrupted)..." : "...");
+                    for (const auto& m : moves) {
+                        apply_move(m, a);
+                    }
+                    if (!compare(a,b) || control.progress() != 1.0) {
+                        std::cerr << " fail!\n";
+                    }
+                    else {
+                        std::cerr << " success!\n";
+                    }
+                }
+            }
+        }
+        {
+            std::cerr << "Cancelling...";
+            auto a = readFile("./testdata/large1");
+            auto b = readFile("./testdata/large2");
+            Control control;
+            auto future = myers_async(a, b, control);
+            control.cancel();
+            auto moves = future.get();
+            for (const auto& m : moves) {
+                apply_move(m, a);
+            }
+            if (!compare(a,b) || !control.interrupted()) {
+                std::cerr << " fail!\n";
+            }
+            else {
+                std::cerr << " success!\n";
+            }
+        }
+        {
+            std::cerr << "Comparing (reused control) large1 with large2...";
+            auto a = readFile("./testdata/large1");
+            auto b = readFile("./testdata/large2");
+            Control control{std::chrono::milliseconds(1)};
+            auto moves = myers_async(a, b, control).get();
+            const bool first{control.interrupted() && control.finished()};
+            // Equal containers need no step: the expired deadline is not hit
+            using Controlled = Policy<Sequential, NoTranspose, std::equal_to<>, Deadline>;
+            NoStats stats;
+            auto same = myers_unfilled<Controlled>(a, a, -1, stats, control);
+            if (!first || control.interrupted() || !control.finished() || !same.empty()) {
+                std::cerr << " fail!\n";
+            }
+            else {
+                std::cerr << " success!\n";
+            }
+        }
+        {
+            std::cerr << "Comparing (progress) large1 with large2...";
+            auto a = readFile("./testdata/large1");
+            auto b = readFile("./testdata/large2");
+            Control control{std::chrono::milliseconds(300)};
+            auto future = myers_async(a, b, control);
+            std::vector<double> samples;
+            while (future.wait_for(std::chrono::milliseconds(20)) != std::future_status::ready) {
+                samples.push_back(control.progress());
+            }
+            auto moves = future.get();
+            for (const auto& m : moves) {
+                apply_move(m, a);
+            }
+            bool running{false};
+            bool increasing{true};
+            for (std::size_t i{0}; i < samples.size(); ++i) {
+                running = running || (samples[i] > 0.0 && samples[i] < 1.0);
+                increasing = increasing && (i == 0 || samples[i] >= samples[i - 1]);
+            }
+            if (!compare(a,b) || !running || !increasing || control.progress() != 1.0) {
+                std::cerr << " fail!\n";
+            }
+            else {
+                std::cerr << " success!\n";
+            }
+        }
+        {
+            std::string basePath{"./testdata/"};
+            auto files = {"alpha", "ban", "ben", "beta", "delta", "empty", "first", "gamma", "second", "test1", "test2", "third", "x", "y"};
+            for(const auto& fa : files) {
+                for (const auto& fb : files) {
+                    std::cerr << "Comparing (inverted) " << fa << " with " << fb << "...";
+                    auto a = readFile(basePath+ fa);
+                    auto b = readFile(basePath+ fb);
+                    auto moves = myers(a, b);
+                    myers_strip_moves(moves);
+                    auto rollback = invert(moves, a);
+                    auto c = b;
+                    for (const auto& m : rollback) {
+                        apply_move(m, c);
+                    }
+                    auto unfilled = invert(myers_unfilled(a, b), a);
+                    auto d = b;
+                    apply_moves(unfilled, d);
+                    if (!compare(c,a) || !compare(d,a)) {
+                        std::cerr << " fail!\n";
+                    }
+                    else {
+                        std::cerr << " success!\n";
+                    }
+                }
+            }
+        }
+        {
+            std::string basePath{"./testdata/"};
+            auto files = {"alpha", "ban", "ben", "beta", "delta", "empty", "first", "gamma", "second", "test1", "test2", "third", "x", "y"};
+            for(const auto& fa : files) {
+                for (const auto& fb : files) {
+                    std::cerr << "Comparing (coarse) " << fa << " with " << fb << "...";
+                    auto a = readFile(basePath+ fa);
+                    auto b = readFile(basePath+ fb);
+                    auto moves = myers_coarse(a, b, -1, 4);
+                    auto transposed = myers_coarse<Policy<Sequential, Transpose>>(a, b, -1, 4);
+                    auto c = a;
+                    apply_moves(moves, a);
+                    apply_moves(transposed, c);
+                    if (!compare(a,b) || !compare(c,b)) {
+                        std::cerr << " fail!\n";
+                    }
+                    else {
+                        std::cerr << " success!\n";
+                    }
+                }
+            }
+        }
+        {
+            for (auto s{2}; s <= 16; ++s) {
+                auto vsize = pow(2, s);
+                std::cerr << "Comparing (sorted) vectors of size " << vsize << "...";
+                std::vector<int_fast64_t> a;
+                std::vector<int_fast64_t> b;
+                for(int_fast64_t x{0}; x < vsize; ++x) {
+                    a.push_back(2 * x);
+                    b.push_back(3 * x);
+                }
+                auto moves = myers_sorted(a, b);
+                apply_moves(moves, a);
+                if (!compare(a,b)) {
+                    std::cerr << " fail!\n";
+                }
+                else {
+                    std::cerr << " success!\n";
+                }
+            }
+        }
         exit(0);
     }
 }